@@ -0,0 +1,273 @@
+/*
+ * Atlas.cpp - Pack the per-directory thumbnails into a small number of fixed-size atlas images with a JSON coordinate index
+ * This file is part of CoinPictureManager.
+ *
+ * Copyright (C) 2020  PolarPiBerry
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Atlas.h"
+#include "ImageFunctions.h"
+
+#include <map>
+#include <set>
+
+//Location of one directory's thumbnail in the atlas
+struct AtlasEntry {
+	std::string name; //Directory name
+	std::string stamp; //Version of the thumbnail file when it was packed
+	int page; //Atlas page number
+	Rect rect; //Location of the thumbnail on the page
+};
+
+//Row of thumbnails on an atlas page
+struct Shelf {
+	int used; //Width used so far
+	int height; //Height of the tallest thumbnail on the shelf
+};
+
+/*
+ * Get the path of an atlas page image
+ *
+ * @param root_dir Top directory (where the atlas is stored)
+ * @param page Page number
+ * @return Path of the page image
+ */
+fs::path atlasPagePath(fs::path root_dir, int page) {
+	return root_dir / ("atlas_" + std::to_string(page) + ".jpg");
+}
+
+/*
+ * Read the entries of an existing atlas index
+ *
+ * @param index_path Path to the index file
+ * @param entries Pointer to a vector to store the entries in
+ * @return Page size of the atlas (0 if there is no index)
+ */
+int readAtlasIndex(fs::path index_path, vector<AtlasEntry> *entries) {
+	if (!fs::exists(index_path)) return 0;
+	FileStorage store(index_path.string(), FileStorage::READ);
+	if (!store.isOpened()) return 0;
+
+	FileNode nodes = store["entries"];
+	for (FileNodeIterator it = nodes.begin(); it != nodes.end(); ++it) {
+		FileNode n = *it;
+		AtlasEntry e;
+		e.name = (std::string)n["name"];
+		e.stamp = (std::string)n["stamp"];
+		e.page = (int)n["page"];
+		e.rect = Rect((int)n["x"], (int)n["y"], (int)n["width"], (int)n["height"]);
+		entries->push_back(e);
+	}
+	return (int)store["page_size"];
+}
+
+/*
+ * Write the atlas index
+ *
+ * @param index_path Path to the index file
+ * @param page_size Width and height (pixels) of each page
+ * @param pages Number of pages
+ * @param entries Entries to write
+ */
+void writeAtlasIndex(fs::path index_path, int page_size, int pages, vector<AtlasEntry> &entries) {
+	FileStorage store(index_path.string(), FileStorage::WRITE);
+	store << "page_size" << page_size;
+	store << "pages" << "[";
+	for (int page = 0; page < pages; page++) {
+		store << atlasPagePath(fs::path(), page).string();
+	}
+	store << "]";
+	store << "entries" << "[";
+	for (auto &e : entries) {
+		store << "{" << "name" << e.name << "stamp" << e.stamp << "page" << e.page
+			<< "x" << e.rect.x << "y" << e.rect.y << "width" << e.rect.width << "height" << e.rect.height << "}";
+	}
+	store << "]";
+}
+
+/*
+ * Find room for a thumbnail on an atlas page using shelf packing (rows of thumbnails, each as tall as the first thumbnail placed on it)
+ *
+ * @param placed Thumbnails already on the page
+ * @param page_size Width and height (pixels) of the page
+ * @param rect Pointer to the thumbnail rectangle (size is used, location is set if it fits)
+ * @return true if the thumbnail fits on the page
+ */
+bool packRect(vector<Rect> &placed, int page_size, Rect *rect) {
+	std::map<int, Shelf> shelves; //Shelves by top edge
+	int bottom = 0;
+	for (auto &r : placed) { //Rebuild the shelves from the thumbnails already on the page
+		Shelf &s = shelves[r.y];
+		s.used = max(s.used, r.x + r.width);
+		s.height = max(s.height, r.height);
+		bottom = max(bottom, r.y + r.height);
+	}
+
+	for (auto &s : shelves) { //First shelf with room
+		if ((*rect).height <= s.second.height && s.second.used + (*rect).width <= page_size) {
+			(*rect).x = s.second.used;
+			(*rect).y = s.first;
+			return true;
+		}
+	}
+	if (bottom + (*rect).height <= page_size) { //Start a new shelf
+		(*rect).x = 0;
+		(*rect).y = bottom;
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Pack the thumbnails of each subdirectory of root_dir into atlas pages (atlas_N.jpg) with an index of their locations (ATLAS_INDEX_NAME).
+ * Only thumbnails that are new or have changed since the last run are packed again, and only the pages they are on are re-rendered
+ *
+ * @param root_dir Top directory (to search below)
+ * @param page_size Width and height (pixels) of each atlas page
+ * @param verbose Verbose
+ * @return Success code
+ */
+int createAtlas(fs::path root_dir, int page_size, bool verbose) {
+	fs::path index_path = root_dir / ATLAS_INDEX_NAME;
+	vector<AtlasEntry> old_entries;
+	if (readAtlasIndex(index_path, &old_entries) != page_size) { //Page size changed - rebuild every page
+		old_entries.clear();
+	}
+	std::map<std::string, AtlasEntry> packed;
+	for (auto &e : old_entries) {
+		packed[e.name] = e;
+	}
+
+	vector<AtlasEntry> entries; //Thumbnails with a location
+	vector<AtlasEntry> pending; //Thumbnails still to be placed
+	std::set<int> dirty; //Pages to re-render
+	std::set<std::string> found;
+
+	for (auto &d : fs::directory_iterator(root_dir)) { //Each sub-directory with a thumbnail
+		fs::path thumb_path = d.path() / THUMBNAIL_NAME;
+		if (!fs::is_directory(d) || !fs::exists(thumb_path)) continue;
+
+		AtlasEntry e;
+		e.name = d.path().filename().string();
+		e.stamp = fileStamp(thumb_path);
+		found.insert(e.name);
+
+		auto old = packed.find(e.name);
+		if (old != packed.end() && old->second.stamp == e.stamp) { //Unchanged - keep location
+			entries.push_back(old->second);
+			continue;
+		}
+
+		Mat thumb = imread(thumb_path.string());
+		if (!thumb.data) {
+			std::cout << "Error! " << thumb_path << ": Unable to open image" << std::endl;
+			if (old != packed.end()) dirty.insert(old->second.page); //Clear the old thumbnail from its page
+			continue;
+		}
+		if (verbose) std::cout << "\tDirectory: " << d.path().filename() << (old == packed.end() ? " (new)" : " (changed)") << std::endl;
+
+		double scale = min(1.0, page_size / (double)max(thumb.cols, thumb.rows)); //Shrink thumbnails larger than a page
+		e.rect = Rect(0, 0, max(1, (int)(thumb.cols * scale)), max(1, (int)(thumb.rows * scale)));
+		if (old != packed.end()) {
+			dirty.insert(old->second.page);
+			if (old->second.rect.size() == e.rect.size()) { //Same size - redraw in place
+				e.page = old->second.page;
+				e.rect = old->second.rect;
+				entries.push_back(e);
+				continue;
+			}
+		}
+		pending.push_back(e);
+	}
+
+	for (auto &e : old_entries) { //Removed directories leave a gap on their page
+		if (found.count(e.name) == 0) {
+			if (verbose) std::cout << "\tDirectory: \"" << e.name << "\" (removed)" << std::endl;
+			dirty.insert(e.page);
+		}
+	}
+
+	//Repack the pages that changed to close any gaps (thumbnails that no longer fit are placed again below)
+	vector<AtlasEntry> kept;
+	for (auto &e : entries) {
+		if (dirty.count(e.page) == 0) kept.push_back(e);
+	}
+	for (int page : dirty) {
+		vector<Rect> placed;
+		for (auto &e : entries) {
+			if (e.page != page) continue;
+			AtlasEntry moved = e;
+			if (packRect(placed, page_size, &moved.rect)) {
+				placed.push_back(moved.rect);
+				kept.push_back(moved);
+			} else {
+				pending.push_back(e);
+			}
+		}
+	}
+	entries = kept;
+
+	//Place new thumbnails on the first page with room, adding pages as needed
+	int pages = 0;
+	for (auto &e : entries) {
+		pages = max(pages, e.page + 1);
+	}
+	std::sort(pending.begin(), pending.end(), [](const AtlasEntry &a, const AtlasEntry &b) { return a.name < b.name; });
+	for (auto &e : pending) {
+		for (e.page = 0; ; e.page++) {
+			vector<Rect> placed;
+			for (auto &p : entries) {
+				if (p.page == e.page) placed.push_back(p.rect);
+			}
+			if (packRect(placed, page_size, &e.rect)) break;
+		}
+		pages = max(pages, e.page + 1);
+		dirty.insert(e.page);
+		entries.push_back(e);
+		if (verbose) std::cout << "\t\tPacked \"" << e.name << "\" into page " << e.page << std::endl;
+	}
+
+	//Render the changed pages (and any that are missing)
+	for (int page = 0; page < pages; page++) {
+		if (!fs::exists(atlasPagePath(root_dir, page))) dirty.insert(page);
+	}
+	int updated = 0;
+	for (int page : dirty) {
+		if (page >= pages) continue;
+		updated++;
+		if (verbose) std::cout << "\tWriting atlas page " << page << std::endl;
+		Mat3b atlas(page_size, page_size, Vec3b(255, 255, 255));
+		for (auto &e : entries) {
+			if (e.page != page) continue;
+			Mat thumb = imread((root_dir / e.name / THUMBNAIL_NAME).string());
+			if (!thumb.data) { //Removed or unreadable since it was packed - leave a gap
+				std::cout << "Error! " << (root_dir / e.name / THUMBNAIL_NAME) << ": Unable to open image" << std::endl;
+				continue;
+			}
+			Mat fitted;
+			resize(thumb, fitted, e.rect.size());
+			fitted.copyTo(atlas(e.rect));
+		}
+		imwrite(atlasPagePath(root_dir, page).string(), atlas);
+	}
+	for (int page = pages; fs::exists(atlasPagePath(root_dir, page)); page++) { //Remove pages that are no longer used
+		fs::remove(atlasPagePath(root_dir, page));
+	}
+
+	writeAtlasIndex(index_path, page_size, pages, entries);
+	std::cout << "Atlas: " << entries.size() << " thumbnails on " << pages << " page(s), " << updated << " page(s) updated" << std::endl;
+	return 0;
+}
@@ -0,0 +1,10 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include "Dependencies.h"
+
+#define ATLAS_INDEX_NAME "atlas.json"
+
+int createAtlas(fs::path root_dir, int page_size, bool verbose); //Pack the thumbnails of each subdirectory of root_dir into atlas pages of page_size x page_size pixels, only re-rendering the pages that changed
+
+#endif
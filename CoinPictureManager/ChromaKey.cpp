@@ -19,38 +19,51 @@
  */
 
 #include "ChromaKey.h"
+#include "ImageFunctions.h"
 
 const char *window_name = "Adjust Chroma Key";
 
+//Starting MAX and MIN values for alpha function (used when no background is found to suggest values from)
+const int DEFAULT_ALPHA_MIN = 25;
+const int DEFAULT_ALPHA_MAX = 75;
+
 //MAX and MIN values for alpha function, adjusted by trackbars
-int ALPHA_MIN = 25;
-int ALPHA_MAX = 75;
+int ALPHA_MIN = DEFAULT_ALPHA_MIN;
+int ALPHA_MAX = DEFAULT_ALPHA_MAX;
 
 //Trackbar pointers
 int alpha_min_slider = ALPHA_MIN;
 int alpha_max_slider = ALPHA_MAX;
 
-//Main image
-Mat bgra; //Input image (BGRA format)
+const int alpha_margin = 25; //Distance of the suggested min and max values from the threshold found
+
+//Image being chroma keyed
+struct ChromaKeyItem : ReviewItem {
+	int alpha_min = 0, alpha_max = 0; //Suggested, then chosen, thresholds
+};
 
+ChromaKeyItem *chroma_item; //Image being reviewed (BGRA format)
 
-Size newsize; //Global cropped image size
+std::string keyed_format = "png";
+int png_level = 3;
 
 /*
  * Alpha mapping function for 0-510 color distance value to a 0-255 alpha value
  *
  * @param d Color distance value (2*color1 - color2 - color3)
+ * @param alpha_min Distance below which pixels are opaque
+ * @param alpha_max Distance above which pixels are transparent
  * @return Alpha value (unsigned char, or int of value 0-255)
  */
-uchar alphaMap(int d) {
-	if (d < ALPHA_MIN) {
+uchar alphaMap(int d, int alpha_min, int alpha_max) {
+	if (d < alpha_min) {
 		return 255;
 	}
-	else if (d > ALPHA_MAX) {
+	else if (d > alpha_max) {
 		return 0;
 	}
 	else {
-		return 255 * (1 - (d - ALPHA_MIN) / (ALPHA_MAX - ALPHA_MIN));
+		return 255 * (1 - (d - alpha_min) / (alpha_max - alpha_min));
 	}
 }
 
@@ -58,8 +71,10 @@ uchar alphaMap(int d) {
  * Run chroma key function on supplied image (overwrites pixel values of given image)
  *
  * @param img Pointer to image to run chroma keying on
+ * @param alpha_min Distance below which pixels are opaque
+ * @param alpha_max Distance above which pixels are transparent
  */
-void chromaKey(Mat *img) {
+void chromaKey(Mat *img, int alpha_min, int alpha_max) {
 	uchar *bp = (*img).data;
 	uchar *gp = bp + 1;
 	uchar *rp = gp + 1;
@@ -67,7 +82,7 @@ void chromaKey(Mat *img) {
 
 	for (int i = 0; i < (*img).cols*(*img).rows; i++) { //Iterate over each pixel in image
 		if (*bp >= *gp && *bp >= *rp) {
-			*ap = alphaMap(2 * *bp - (*gp + *rp));
+			*ap = alphaMap(2 * *bp - (*gp + *rp), alpha_min, alpha_max);
 			*bp = (255 - *ap) + *bp*(*ap) / 255;
 			*gp = (255 - *ap) + *gp*(*ap) / 255;
 			*rp = (255 - *ap) + *rp*(*ap) / 255;
@@ -85,11 +100,10 @@ void chromaKey(Mat *img) {
  * Update the current shown image
  */
 void updateDisplay() {
-	Mat img_show;
+	Mat img_show = chroma_item->preview.clone();
 
-	resize(bgra, img_show, newsize);
 	//std::chrono::time_point<std::chrono::system_clock> start_time = std::chrono::system_clock::now();
-	chromaKey(&img_show); //Run chroma key function
+	chromaKey(&img_show, ALPHA_MIN, ALPHA_MAX); //Run chroma key function
 	//std::chrono::time_point<std::chrono::system_clock> end_time = std::chrono::system_clock::now(); //Calculate time elapsed and print
 	//double elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count();
 	//std::cout << "Proccessing loop time: " << elapsed_ms << " ms" << std::endl;
@@ -112,48 +126,138 @@ void onTrackbar(int sp, void *val) {
 		ALPHA_MIN = alpha_min_slider;
 		ALPHA_MAX = alpha_max_slider;
 	}
-	std::cout << ALPHA_MIN << " " << ALPHA_MAX << std::endl;
+	printLine(std::to_string(ALPHA_MIN) + " " + std::to_string(ALPHA_MAX));
 	updateDisplay();
 }
 
 /*
- * Run chroma keying on the image at the supplied filename and save to the supplied output filename, showing an OpenCV GUI to adjust the max and min alpha values
+ * Suggest alpha min and max values for an image, using Otsu's method to find the color distance that best separates the background from the coin
  *
- * @param filename Input filename
- * @param output_filename Output filename
+ * @param item Pointer to the image (preview must be set; alpha_min and alpha_max are set)
+ */
+void suggestAlpha(ChromaKeyItem *item) {
+	//Histogram of color distances in the preview
+	vector<double> hist(511, 0);
+	int n = item->preview.cols*item->preview.rows;
+	uchar *p = item->preview.data;
+	for (int i = 0; i < n; i++) {
+		hist[(p[0] >= p[1] && p[0] >= p[2]) ? 2 * p[0] - (p[1] + p[2]) : 0]++;
+		p += 4;
+	}
+
+	double sum = 0;
+	for (int d = 0; d < 511; d++) {
+		sum += d * hist[d];
+	}
+	double sum_b = 0, w_b = 0, best = 0;
+	int best_d = -1;
+	for (int d = 0; d < 511; d++) { //Threshold with the largest variance between the two classes
+		w_b += hist[d];
+		double w_f = n - w_b;
+		if (w_b == 0) continue;
+		if (w_f == 0) break;
+		sum_b += d * hist[d];
+		double diff = sum_b / w_b - (sum - sum_b) / w_f;
+		double between = w_b * w_f * diff * diff;
+		if (between > best) {
+			best = between;
+			best_d = d;
+		}
+	}
+
+	if (best_d < 0) { //No background found - use the starting values
+		item->alpha_min = DEFAULT_ALPHA_MIN;
+		item->alpha_max = DEFAULT_ALPHA_MAX;
+	} else {
+		item->alpha_min = max(0, best_d - alpha_margin);
+		item->alpha_max = min(510, best_d + alpha_margin);
+	}
+}
+
+/*
+ * Create an empty review item for chroma keying
+ *
+ * @return Item (path is set by runReview)
+ */
+ReviewItemPtr newChromaKeyItem() {
+	return std::make_shared<ChromaKeyItem>();
+}
+
+/*
+ * Read the image and create its preview and suggested alpha values (can run in the background while another image is reviewed)
+ *
+ * @param review_item Pointer to the image (a ChromaKeyItem with its path set)
  * @return Success code
  */
-int chromaKeyInterface(const char* filename, const char *output_filename) {
-	Mat image;
-	image = imread(filename, IMREAD_COLOR);
+int prepareChromaKey(ReviewItem *review_item) {
+	ChromaKeyItem *item = (ChromaKeyItem*)review_item;
+	Mat image = imread(item->path.string(), IMREAD_COLOR);
 	if (!image.data) {
-		std::cout << "Unable to open image " << filename << std::endl;
+		printLine("Unable to open image " + item->path.string());
 		return 1;
 	}
 
-#ifdef _WIN32
-	newsize = Size(GetSystemMetrics(SM_CYSCREEN) - 200, (GetSystemMetrics(SM_CYSCREEN) - 200) * image.rows / image.cols); //Resize image to a reasonable size for display
-#elif __linux__
-	Display* d = XOpenDisplay(NULL);
-	Screen*  s = DefaultScreenOfDisplay(d);
-	Size newsize(s->width - 200, (s->height - 200) * img_show.rows / img_show.cols); //Resize image to a reasonable size for display
-#endif
+	cvtColor(image, item->image, COLOR_BGR2BGRA);
+	resize(item->image, item->preview, fitToScreen(image.size()), 0, 0, INTER_AREA); //Resize image to a reasonable size for display
+	suggestAlpha(item);
+	return 0;
+}
 
-	cvtColor(image, bgra, COLOR_BGR2BGRA);
+/*
+ * Show the prepared image in an OpenCV GUI to adjust the max and min alpha values, starting from the suggested values (GUI thread only)
+ *
+ * @param review_item Pointer to the prepared image (alpha_min and alpha_max are set to the chosen values)
+ * @return Success code
+ */
+int reviewChromaKey(ReviewItem *review_item) {
+	ChromaKeyItem *item = (ChromaKeyItem*)review_item;
+	chroma_item = item;
+	alpha_min_slider = item->alpha_min;
+	alpha_max_slider = item->alpha_max;
 
 	namedWindow(window_name, WINDOW_AUTOSIZE); //Create named window to place sliders and image upon
 
 	createTrackbar("Alpha Min", window_name, &alpha_min_slider, 510, onTrackbar); //Create trackbars to adjust alpha min and max values
 	createTrackbar("Alpha Max", window_name, &alpha_max_slider, 510, onTrackbar);
+	setTrackbarPos("Alpha Max", window_name, item->alpha_max); //Trackbars from the previous image keep their position
+	setTrackbarPos("Alpha Min", window_name, item->alpha_min);
 	onTrackbar(0, 0);
 	waitKey(0);
 
-	std::cout << "Saving image..." << std::endl;
+	item->alpha_min = ALPHA_MIN;
+	item->alpha_max = ALPHA_MAX;
+	chroma_item = NULL;
+	return 0;
+}
+
+/*
+ * Run chroma keying on the reviewed image with the chosen alpha values and save it in an alpha-capable format to KEYED_DIR_NAME/NAME.keyed_format
+ * next to the original (can run in the background, several at once)
+ *
+ * @param review_item Pointer to the reviewed image
+ * @return Success code
+ */
+int saveChromaKey(ReviewItem *review_item) {
+	ChromaKeyItem *item = (ChromaKeyItem*)review_item;
+	chromaKey(&item->image, item->alpha_min, item->alpha_max);
 
-	chromaKey(&bgra);
-	imwrite(output_filename, bgra);
+	vector<int> params;
+	if (keyed_format == "webp") {
+		params.push_back(IMWRITE_WEBP_QUALITY);
+		params.push_back(101); //Lossless
+	} else {
+		params.push_back(IMWRITE_PNG_COMPRESSION);
+		params.push_back(png_level);
+	}
+	fs::path output_dir = item->path.parent_path() / KEYED_DIR_NAME;
+	fs::create_directories(output_dir);
+	fs::path output_path = output_dir / (item->path.stem().string() + "." + keyed_format);
+	if (!imwrite(output_path.string(), item->image, params)) {
+		printLine("Unable to save image " + output_path.string());
+		return 1;
+	}
 
-	std::cout << "Image saved to " << output_filename << std::endl;
+	printLine("Image saved to " + output_path.string());
 
 	return 0;
 }
\ No newline at end of file
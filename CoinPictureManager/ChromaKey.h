@@ -2,7 +2,19 @@
 #define CHROMAKEY_H
 
 #include "Dependencies.h"
+#include "Scheduler.h"
 
-int chromaKeyInterface(const char *filename, const char *output_filename);
+#define KEYED_DIR_NAME "keyed"
+
+extern std::string keyed_format; //Format of chroma keyed images ("png" or "webp", both keep the alpha channel)
+extern int png_level; //PNG compression level (0-9, higher is smaller but slower)
+
+ReviewItemPtr newChromaKeyItem(); //Create an empty review item for chroma keying
+
+int prepareChromaKey(ReviewItem *item); //Read the image at item->path and create its display preview and suggested alpha values
+
+int reviewChromaKey(ReviewItem *item); //Show the prepared image to choose the alpha values (GUI REQUIRED)
+
+int saveChromaKey(ReviewItem *item); //Chroma key the reviewed image and save it (with alpha) to KEYED_DIR_NAME/NAME.keyed_format next to the original
 
 #endif
\ No newline at end of file
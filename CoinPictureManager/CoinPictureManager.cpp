@@ -19,12 +19,20 @@
  */
 
 #include "Dependencies.h"
+#include "Atlas.h"
 #include "ChromaKey.h"
 #include "CropImages.h"
 #include "ImageFunctions.h"
+#include "PerceptualHash.h"
+#include "Scheduler.h"
 
 #define DEFAULT_PATH "./Public"
 
+//Shard of the subdirectories processed by this run (set with --shard i/N so several machines can split the work)
+int shard_index = 0;
+int shard_count = 1;
+bool shard_given = false; //Write the shard completion/metrics file (set by --shard, even for --shard 0/1)
+
 std::string info_str = "Manage and prepare coin pictures located in subdirectories of DIRECTORY";
 
 std::string console_usage_str = "\
@@ -37,14 +45,22 @@ Options:\n\
 \t-i\t\tInteractive mode (default unless other option specified)\n\
 \t-v\t\tVerbose mode\n\
 \t-c=COMMANDS\t\tRun command(s) (commands run in order listed; see available commands below)\n\
+\t--shard i/N\tOnly process shard i (0 to N-1) of the subdirectories, writing shard_i_of_N.json when done\n\
+\t--mem-limit=MB\tMemory budget for images processed in parallel by commands 2-6 (default: no limit)\n\
+\t--keyed-format=FORMAT\tFormat of chroma keyed images: png (default) or webp (lossless)\n\
+\t--png-level=LEVEL\tPNG compression level of chroma keyed images, 0-9 (default: 3)\n\
+\t--find=IMAGE\tList images in the duplicate photo indexes that duplicate IMAGE (see command 8; runs after any commands)\n\
+\t--dup-distance=BITS\tMaximum number of differing hash bits for two images to be duplicates, 0-64 (default: 4)\n\
 \n\
 Commands:\n\
 \t1\t\tRename files to sequential numbers\n\
 \t2\t\tCreate thumbnails\n\
 \t3\t\tCreate thumbnails from the first two images only\n\
 \t4\t\tCreate WebP images\n\
-\t5\t\tChroma Key images (GUI required)\n\
+\t5\t\tChroma Key images (GUI required; saved with alpha to keyed/ in each directory)\n\
 \t6\t\tCrop images (GUI required)\n\
+\t7\t\tCreate thumbnail atlas (from existing thumbnails)\n\
+\t8\t\tUpdate duplicate photo index (commands 2-4 then skip duplicates)\n\
 ";
 
 std::string help_str = "-------------- PictureManager --------------\n----- Manage and prepare coin pictures -----\n\n\
@@ -54,7 +70,7 @@ Run commands (enter l for a list or h for help)\n";
 std::string command_str = "\nAvailable commands: \n\t1: renaming files to sequential numbers\n\
 \t2: create thumbnails with all images\n\t3: create thumbnails from the first two images\n\
 \t4: create WebP images\n\t5: run chroma keying \n\
-\t6: crop each image \n\tl: show this list\n\tl: show help\n\tq: quit\n\n\n";
+\t6: crop each image \n\t7: pack thumbnails into an atlas \n\t8: update duplicate photo index \n\tl: show this list\n\tl: show help\n\tq: quit\n\n\n";
 
 std::string verify_str = "Files MUST be organized as follows : \n\
 / This directory \n\
@@ -70,6 +86,75 @@ std::string verify_str = "Files MUST be organized as follows : \n\
 \t\t\tPICN.jpg\n";
 
 
+/*
+ * Stable hash of a directory name (FNV-1a - the same on every machine and compiler, unlike std::hash)
+ *
+ * @param name Directory name
+ * @return 64-bit hash
+ */
+uint64_t hashName(std::string name) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : name) {
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+ * Determine if a subdirectory belongs to the shard processed by this run
+ *
+ * @param dir Path of the subdirectory
+ * @return bool if the subdirectory should be processed
+ */
+bool inShard(fs::path dir) {
+	return shard_count <= 1 || hashName(dir.filename().string()) % shard_count == (uint64_t)shard_index;
+}
+
+/*
+ * Write the completion/metrics file for this shard (shard_i_of_N.json in root_dir)
+ *
+ * @param root_dir Top directory (to search below)
+ * @param commands Commands to run
+ * @param statuses Status code of each command run
+ * @param seconds Time taken (seconds) by each command run
+ */
+void writeShardMetrics(fs::path root_dir, std::vector<char> &commands, std::vector<int> &statuses, std::vector<double> &seconds) {
+	std::vector<std::string> dirs;
+	int images = 0;
+	for (auto &d: fs::directory_iterator(root_dir)) { //Each sub-directory in this shard
+		if (fs::is_directory(d) && inShard(d.path())) {
+			dirs.push_back(d.path().filename().string());
+			for (auto &f: fs::directory_iterator(d)) {
+				if (isImage(f.path().extension().string())) images++;
+			}
+		}
+	}
+	std::sort(dirs.begin(), dirs.end());
+
+	bool complete = statuses.size() == commands.size();
+	for (int status : statuses) {
+		complete = complete && status <= 0;
+	}
+
+	fs::path metrics_path = root_dir / ("shard_" + std::to_string(shard_index) + "_of_" + std::to_string(shard_count) + ".json");
+	FileStorage store(metrics_path.string(), FileStorage::WRITE);
+	store << "shard" << shard_index << "shards" << shard_count;
+	store << "complete" << (int)complete;
+	store << "images" << images;
+	store << "commands" << "[";
+	for (unsigned int i = 0; i < statuses.size(); i++) {
+		store << "{" << "command" << std::string(1, commands.at(i)) << "status" << statuses.at(i) << "seconds" << seconds.at(i) << "}";
+	}
+	store << "]";
+	store << "directories" << "[";
+	for (auto &name : dirs) {
+		store << name;
+	}
+	store << "]";
+	std::cout << "Shard " << shard_index << "/" << shard_count << (complete ? " complete" : " failed") << " (" << dirs.size() << " directories): " << metrics_path.string() << std::endl;
+}
+
 /*
  * Rename the files in subdirectories of root_dir to sequential numbers
  *
@@ -79,7 +164,7 @@ std::string verify_str = "Files MUST be organized as follows : \n\
 int renameFiles(fs::path root_dir, bool verbose) {
 	std::cout << "Renaming files in subdirectories" << std::endl;
 	for (auto &d: fs::directory_iterator(root_dir)) { //Each sub-directory
-		if (fs::is_directory(d)) {
+		if (fs::is_directory(d) && inShard(d.path())) {
 			int f_no = 0;
 			if (verbose) std::cout << "\tDirectory: " << d.path().filename() << std::endl;
 			for (auto &f: fs::directory_iterator(d)) { //Each image file
@@ -111,13 +196,16 @@ int createThumbnail(fs::path root_dir, int max_imgs, bool verbose) {
 	} else {
 		std::cout << "Creating thumbnail files in subdirectories..." << std::endl;
 	}
+	vector<Job> jobs;
 	for (auto &d: fs::directory_iterator(root_dir)) { //Each sub-directory
-		if (fs::is_directory(d)) {
-			if (verbose) std::cout << "\tDirectory: " << d.path().filename() << std::endl;
-			createThumbnail(d.path(), 250, max_imgs);
+		if (fs::is_directory(d) && inShard(d.path())) {
+			fs::path image_dir = d.path();
+			jobs.push_back({ image_dir.filename().string(), thumbnailMemory(image_dir, max_imgs), [image_dir, max_imgs, verbose]() {
+				return createThumbnail(image_dir, 250, max_imgs, verbose);
+			} });
 		}
 	}
-	return 0;
+	return runJobs(jobs, verbose) > 0 ? 1 : 0;
 }
 
 /*
@@ -128,35 +216,46 @@ int createThumbnail(fs::path root_dir, int max_imgs, bool verbose) {
  */
 int createWebp(fs::path root_dir, bool verbose) {
 	std::cout << "Creating WebP images..." << std::endl;
+	vector<Job> jobs;
 	for (auto &d : fs::directory_iterator(root_dir)) { //Each sub-directory
-		if (fs::is_directory(d)) {
-			if (verbose) std::cout << "\tDirectory: " << d.path().filename() << std::endl;
-			createWebp(d.path(), 50, verbose);
+		if (fs::is_directory(d) && inShard(d.path())) {
+			fs::path image_dir = d.path();
+			jobs.push_back({ image_dir.filename().string(), webpMemory(image_dir), [image_dir, verbose]() {
+				return createWebp(image_dir, 50, verbose);
+			} });
 		}
 	}
-	return 0;
+	return runJobs(jobs, verbose) > 0 ? 1 : 0;
 }
 
 /*
- * Run chroma keying on images in subdirectories of root_dir
+ * List the images in subdirectories of root_dir (in this shard)
  *
  * @param root_dir Top directory (to search below)
- * @param verbose Verbose
+ * @return Paths of the images
  */
-int chromaKey(fs::path root_dir, bool verbose) {
-	std::cout << "Running chroma keying..." << std::endl;
+vector<fs::path> listImages(fs::path root_dir) {
+	vector<fs::path> files;
 	for (auto &d: fs::directory_iterator(root_dir)) { //Each sub-directory
-		if (fs::is_directory(d)) {
-			if (verbose) std::cout << "\tDirectory: " << d.path().filename() << std::endl;
+		if (fs::is_directory(d) && inShard(d.path())) {
 			for (auto &f : fs::directory_iterator(d)) { //Each image file
-				if (isImage(f.path().extension().string())) {
-					if (verbose) std::cout << "\t\tChroma keying image: " << f.path().string() << std::endl;
-					chromaKeyInterface(f.path().string().c_str(), f.path().string().c_str());
-				}
+				if (isImage(f.path().extension().string())) files.push_back(f.path());
 			}
 		}
 	}
-	return 0;
+	return files;
+}
+
+/*
+ * Run chroma keying on images in subdirectories of root_dir
+ *
+ * @param root_dir Top directory (to search below)
+ * @param verbose Verbose
+ */
+int chromaKey(fs::path root_dir, bool verbose) {
+	std::cout << "Running chroma keying..." << std::endl;
+	vector<fs::path> files = listImages(root_dir);
+	return runReview(files, newChromaKeyItem, prepareChromaKey, reviewChromaKey, saveChromaKey, verbose) > 0 ? 1 : 0;
 }
 
 /*
@@ -167,18 +266,43 @@ int chromaKey(fs::path root_dir, bool verbose) {
  */
 int cropImages(fs::path root_dir, bool verbose) {
 	std::cout << "Cropping images..." << std::endl;
-	for (auto &d: fs::directory_iterator(root_dir)) { //Each sub-directory
-		if (fs::is_directory(d)) {
-			if (verbose) std::cout << "\tDirectory: " << d.path().filename() << std::endl;
-			for (auto &f : fs::directory_iterator(d)) { //Each image file
-				if (isImage(f.path().extension().string())) {
-					if (verbose) std::cout << "\t\tCropping image: " << f.path().string() << std::endl;
-					cropImage(f.path().string().c_str(), f.path().string().c_str());
-				}
-			}
+	vector<fs::path> files = listImages(root_dir);
+	return runReview(files, newCropItem, prepareCrop, reviewCrop, saveCrop, verbose) > 0 ? 1 : 0;
+}
+
+/*
+ * Update the duplicate photo index in subdirectories of root_dir
+ *
+ * @param root_dir Top directory (to search below)
+ * @param verbose Verbose
+ */
+int createHashIndex(fs::path root_dir, bool verbose) {
+	std::cout << "Updating duplicate photo index..." << std::endl;
+	vector<Job> jobs;
+	for (auto &d : fs::directory_iterator(root_dir)) { //Each sub-directory
+		if (fs::is_directory(d) && inShard(d.path())) {
+			fs::path image_dir = d.path();
+			jobs.push_back({ image_dir.filename().string(), hashMemory(image_dir), [image_dir, verbose]() {
+				return updateHashIndex(image_dir, verbose);
+			} });
 		}
 	}
-	return 0;
+	return runJobs(jobs, verbose) > 0 ? 1 : 0;
+}
+
+/*
+ * Pack the thumbnails in subdirectories of root_dir into atlas images
+ *
+ * @param root_dir Top directory (to search below)
+ * @param verbose Verbose
+ */
+int createAtlas(fs::path root_dir, bool verbose) {
+	if (shard_count > 1) { //The atlas covers every directory, so it can't be split between shards
+		std::cout << "Skipping thumbnail atlas in shard " << shard_index << "/" << shard_count << " (run command 7 without --shard once every shard is complete)" << std::endl;
+		return 0;
+	}
+	std::cout << "Creating thumbnail atlas..." << std::endl;
+	return createAtlas(root_dir, 2048, verbose);
 }
 
 /*
@@ -201,6 +325,10 @@ int runCommand(char command, bool verbose, bool interactive_mode, fs::path root_
 			return chromaKey(root_dir, verbose);
 		case '6':
 			return cropImages(root_dir, verbose);
+		case '7':
+			return createAtlas(root_dir, verbose);
+		case '8':
+			return createHashIndex(root_dir, verbose);
 		case 'l':
 			if (interactive_mode) {
 				std::cout << command_str;
@@ -242,12 +370,53 @@ int runUI(fs::path root_dir, bool verbose) {
 
 int main(int argc, char **argv) { //Main loop - parse any command line options and run either command or interactive mode
 	bool run_ui = false, verbose = false;
+	fs::path find_path;
 	std::vector<char> commands;
 	fs::path root_dir = fs::path(DEFAULT_PATH);
 
 	//Parse the arguments
 	for (int i = 1; i < argc; i++) {
-		if (argv[i][0] == '-' && strlen(argv[i]) >= 2) { //General option
+		if (strncmp(argv[i], "--shard", 7) == 0) { //Shard of the subdirectories to process
+			const char *shard = (argv[i][7] == '=') ? argv[i] + 8 : (argv[i][7] == '\0' && i + 1 < argc) ? argv[++i] : "";
+			int consumed = 0;
+			if (sscanf(shard, "%d/%d%n", &shard_index, &shard_count, &consumed) != 2 || shard[consumed] != '\0' || shard_count < 1 || shard_index < 0 || shard_index >= shard_count) {
+				std::cout << "Please enter the shard in the format --shard i/N (0 <= i < N)" << std::endl << std::endl;
+				std::cout << console_usage_str;
+				return 1;
+			}
+			shard_given = true;
+		} else if (strncmp(argv[i], "--keyed-format=", 15) == 0) { //Format of chroma keyed images
+			keyed_format = argv[i] + 15;
+			if (keyed_format != "png" && keyed_format != "webp") {
+				std::cout << "Please enter the keyed image format as --keyed-format=png or --keyed-format=webp" << std::endl << std::endl;
+				std::cout << console_usage_str;
+				return 1;
+			}
+		} else if (strncmp(argv[i], "--png-level=", 12) == 0) { //PNG compression level
+			int consumed = 0;
+			if (sscanf(argv[i] + 12, "%d%n", &png_level, &consumed) != 1 || argv[i][12 + consumed] != '\0' || png_level < 0 || png_level > 9) {
+				std::cout << "Please enter the PNG compression level in the format --png-level=LEVEL (0-9)" << std::endl << std::endl;
+				std::cout << console_usage_str;
+				return 1;
+			}
+		} else if (strncmp(argv[i], "--find=", 7) == 0) { //Find duplicates of an image
+			find_path = fs::path(argv[i] + 7);
+		} else if (strncmp(argv[i], "--dup-distance=", 15) == 0) { //Duplicate photo threshold
+			int consumed = 0;
+			if (sscanf(argv[i] + 15, "%d%n", &duplicate_distance, &consumed) != 1 || argv[i][15 + consumed] != '\0' || duplicate_distance < 0 || duplicate_distance > 64) {
+				std::cout << "Please enter the duplicate distance in the format --dup-distance=BITS (0-64)" << std::endl << std::endl;
+				std::cout << console_usage_str;
+				return 1;
+			}
+		} else if (strncmp(argv[i], "--mem-limit=", 12) == 0) { //Memory budget for parallel image jobs
+			long mb = atol(argv[i] + 12);
+			if (mb <= 0) {
+				std::cout << "Please enter the memory limit in the format --mem-limit=MB" << std::endl << std::endl;
+				std::cout << console_usage_str;
+				return 1;
+			}
+			memory_limit = (size_t)mb << 20;
+		} else if (argv[i][0] == '-' && strlen(argv[i]) >= 2) { //General option
 			if (argv[i][1] == 'h') { //Show help
 				std::cout << info_str << std::endl << console_usage_str;
 				return 0;
@@ -282,12 +451,26 @@ int main(int argc, char **argv) { //Main loop - parse any command line options a
 
 	//Run any commands
 	if (commands.size() > 0) {
+		std::vector<int> statuses;
+		std::vector<double> seconds;
 		for (unsigned int i = 0; i < commands.size(); i++) {
 			char comm = commands.at(i);
+			std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
 			int status = runCommand(comm, verbose, false, root_dir);
-			if (status > 0) return 1; //Exit upon error
+			statuses.push_back(status);
+			seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count());
+			if (status > 0) break; //Stop upon error
 		}
+		if (shard_given) writeShardMetrics(root_dir, commands, statuses, seconds);
+		if (statuses.back() > 0) return 1; //Exit upon error
+	}
+
+	//Look up an image in the duplicate photo indexes (after the commands, so -c=8 updates the indexes first)
+	if (!find_path.empty()) {
+		if (findImage(root_dir, find_path, verbose) != 0) return 1;
+	}
 
+	if (commands.size() > 0 || !find_path.empty()) {
 		if (run_ui) { //Enter interactive mode if specified
 			std::cout << "Entering interactive mode..." << std::endl;
 			return runUI(root_dir, verbose);
@@ -19,12 +19,21 @@
  */
 
 #include "CropImages.h"
+#include "ImageFunctions.h"
 
 //Global variables used in update routine
 const char *crop_window_name = "Crop Image";
 int padding_slider = 50; //Padding on bounding rectangle
-Mat img;
-Rect bounding_box;
+const int max_padding = 200; //Maximum of the padding trackbar
+//Image being cropped
+struct CropItem : ReviewItem {
+	Rect bounds; //Bounding box of the coin
+	Rect preview_area; //Area of the image shown in the preview
+	double preview_scale = 1; //Scale from the image to the preview
+	int padding = 0; //Padding chosen around the bounding box
+};
+
+CropItem *crop_item; //Image being reviewed
 
 /*
  * Get the bounding box for the image
@@ -65,14 +74,11 @@ void getBounds(Mat img, Rect *bounding_rect) {
  */
 void padBounds(Mat *img, Rect bounds, int padding, Rect *output) {
 	*output = bounds;
-	(*output).x -= padding_slider;
-	(*output).x = max((*output).x, 0);
-	(*output).y -= padding_slider;
-	(*output).y = max((*output).y, 0);
-	(*output).width += 2 * padding_slider;
-	(*output).width = min((*output).width, (*img).cols);
-	(*output).height += 2 * padding_slider;
-	(*output).height = min((*output).height, (*img).rows);
+	(*output).x -= padding;
+	(*output).y -= padding;
+	(*output).width += 2 * padding;
+	(*output).height += 2 * padding;
+	*output = *output & Rect(0, 0, (*img).cols, (*img).rows); //Keep within the image
 }
 
 /*
@@ -96,6 +102,18 @@ void cropImage(Mat *img, Rect *bounding_rect) {
 	*img = (*img)(tmp);
 }
 
+/*
+ * Create the display-size preview of the area around the bounding box (once per image, so trackbar events don't touch the full-size image)
+ *
+ * @param item Pointer to the image to create the preview for
+ */
+void createPreview(CropItem *item) {
+	padBounds(&item->image, item->bounds, max_padding, &item->preview_area);
+	Size newsize = fitToScreen(item->preview_area.size()); //Resize image to a reasonable size for display
+	item->preview_scale = newsize.width / (double)item->preview_area.width;
+	resize(item->image(item->preview_area), item->preview, newsize, 0, 0, INTER_AREA);
+}
+
 /*
  * Event handler for adjustments to the crop padding trackbar
  *
@@ -103,56 +121,91 @@ void cropImage(Mat *img, Rect *bounding_rect) {
  * @param val Pointer to other fields
  */
 void onCropTrackbar(int sp, void *val) {//Update the current shown image
-	Mat img_show = img.clone();
-	
+	Mat img_show = crop_item->preview.clone();
+
 	//Create a copy of the bounding box and adjust the padding based on the slider value
 	Rect bounding_rect;
-	padBounds(&img, bounding_box, padding_slider, &bounding_rect);
+	padBounds(&crop_item->image, crop_item->bounds, padding_slider, &bounding_rect);
 
-	plotBounds(&img_show, &bounding_rect);
-	cropImage(&img_show, &bounding_rect);
+	//Draw the padded box on the preview
+	double scale = crop_item->preview_scale;
+	Rect shown_rect(
+		(int)((bounding_rect.x - crop_item->preview_area.x) * scale),
+		(int)((bounding_rect.y - crop_item->preview_area.y) * scale),
+		(int)(bounding_rect.width * scale),
+		(int)(bounding_rect.height * scale));
+	plotBounds(&img_show, &shown_rect);
 
-#ifdef _WIN32
-		Size newsize(GetSystemMetrics(SM_CYSCREEN)-200, (GetSystemMetrics(SM_CYSCREEN)-200) * img_show.rows / img_show.cols); //Resize image to a reasonable size for display
-#elif __linux__
-		Display* d = XOpenDisplay(NULL);
-		Screen*  s = DefaultScreenOfDisplay(d);
-		Size newsize(s->width - 200, (s->height - 200) * img_show.rows / img_show.cols); //Resize image to a reasonable size for display
-#endif
-	resize(img_show, img_show, newsize); 
 	imshow(crop_window_name, img_show); //Show final image
 }
 
 /*
- * Crop the image at the supplied filename and save to the supplied output filename, showing an OpenCV GUI to adjust the padding
+ * Create an empty review item for cropping
  *
- * @param filename Input filename
- * @param output_filename Output filename
+ * @return Item (path is set by runReview)
+ */
+ReviewItemPtr newCropItem() {
+	return std::make_shared<CropItem>();
+}
+
+/*
+ * Read the image and find its bounding box and preview (can run in the background while another image is reviewed)
+ *
+ * @param review_item Pointer to the image (a CropItem with its path set)
  * @return Success code
  */
-int cropImage(const char* filename, const char *output_filename) {
-	img = imread(filename, IMREAD_COLOR);
-	if (!img.data) {
-		std::cout << "Error! " << filename << ": Unable to open image"<< std::endl;
+int prepareCrop(ReviewItem *review_item) {
+	CropItem *item = (CropItem*)review_item;
+	item->image = imread(item->path.string(), IMREAD_COLOR);
+	if (!item->image.data) {
+		printLine("Error! " + item->path.string() + ": Unable to open image");
 		return 1;
 	}
 
 	//Get bounding box
-	getBounds(img, &bounding_box);
+	item->bounds = Rect();
+	getBounds(item->image, &item->bounds);
+	createPreview(item);
+	return 0;
+}
+
+/*
+ * Show the prepared image in an OpenCV GUI to adjust the padding (GUI thread only)
+ *
+ * @param review_item Pointer to the prepared image (padding is set to the chosen value)
+ * @return Success code
+ */
+int reviewCrop(ReviewItem *review_item) {
+	CropItem *item = (CropItem*)review_item;
+	crop_item = item;
 
 	namedWindow(crop_window_name, WINDOW_AUTOSIZE); //Create named window to place sliders and image upon
 
-	createTrackbar("Adjust boundary", crop_window_name, &padding_slider, 200, onCropTrackbar); //Create trackbars to adjust alpha min and max values
+	createTrackbar("Adjust boundary", crop_window_name, &padding_slider, max_padding, onCropTrackbar); //Create trackbars to adjust alpha min and max values
 
 	onCropTrackbar(0, 0);
 	waitKey(0);
 
-	//Crop and save final image
-	Rect bounding_rect;
-	padBounds(&img, bounding_box, padding_slider, &bounding_rect);
-	cropImage(&img, &bounding_rect);
-	imwrite(output_filename, img);
+	item->padding = padding_slider;
+	crop_item = NULL;
+	return 0;
+}
 
+/*
+ * Crop the reviewed image to the chosen padding and save it over the original (can run in the background)
+ *
+ * @param review_item Pointer to the reviewed image
+ * @return Success code
+ */
+int saveCrop(ReviewItem *review_item) {
+	CropItem *item = (CropItem*)review_item;
+	Rect bounding_rect;
+	padBounds(&item->image, item->bounds, item->padding, &bounding_rect);
+	cropImage(&item->image, &bounding_rect);
+	if (!imwrite(item->path.string(), item->image)) {
+		printLine("Error! " + item->path.string() + ": Unable to save image");
+		return 1;
+	}
 	return 0;
 }
 
@@ -2,7 +2,14 @@
 #define CROPIMAGE_H
 
 #include "Dependencies.h"
+#include "Scheduler.h"
 
-int cropImage(const char *filename, const char *output_filename); //Crop the image given by filename and save at output_filename (GUI REQUIRED)
+ReviewItemPtr newCropItem(); //Create an empty review item for cropping
+
+int prepareCrop(ReviewItem *item); //Read the image at item->path and find its bounding box and display preview
+
+int reviewCrop(ReviewItem *item); //Show the prepared image to choose the padding around the bounding box (GUI REQUIRED)
+
+int saveCrop(ReviewItem *item); //Crop the reviewed image and save it over the original
 
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 	#include <opencv2/imgproc/imgproc.hpp>
 	#include <iostream>
 	#include <iomanip>
+	#include <chrono>
 	#include <filesystem>
 	#include <string>
 	#include <stdlib.h>
@@ -19,6 +19,10 @@
  */
 
 #include "ImageFunctions.h"
+#include "PerceptualHash.h"
+#include "Scheduler.h"
+
+#include <fstream>
 
 /*
  * Determine if file is an acceptable image format based on extension
@@ -31,22 +35,212 @@ bool isImage(std::string ext) {
 	return ext==".jpg" || ext==".jpeg" || ext==".jpe" || ext==".jp2" || ext==".png";
 }
 
+/*
+ * Get a stamp for the current version of a file (changes whenever the file is rewritten)
+ *
+ * @param path Path to the file
+ * @return Stamp of the modification time and size of the file
+ */
+std::string fileStamp(fs::path path) {
+	return std::to_string(fs::last_write_time(path).time_since_epoch().count()) + "-" + std::to_string(fs::file_size(path));
+}
+
+/*
+ * Read a big-endian integer from a file
+ *
+ * @param file File stream to read from
+ * @param bytes Number of bytes in the integer
+ * @return Integer read
+ */
+unsigned int readBigEndian(std::ifstream &file, int bytes) {
+	unsigned int val = 0;
+	for (int i = 0; i < bytes; i++) {
+		val = (val << 8) | (unsigned char)file.get();
+	}
+	return val;
+}
+
+/*
+ * Read the size of an image from its header (without decoding the image)
+ *
+ * @param path Path to the image (JPEG, JPEG 2000 or PNG)
+ * @param size Pointer to a size to store the image size in
+ * @return bool if the size was found
+ */
+bool readImageSize(fs::path path, Size *size) {
+	std::ifstream file(path.string(), std::ios::binary);
+	unsigned char sig[12] = { 0 };
+	file.read((char *)sig, sizeof(sig));
+	if (!file) return false;
+
+	if (sig[0] == 0xFF && sig[1] == 0xD8) { //JPEG - find the start of frame marker
+		file.seekg(2);
+		while (file) {
+			if (file.get() != 0xFF) return false;
+			int marker = file.get();
+			while (marker == 0xFF) marker = file.get(); //Fill bytes
+			if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue; //Markers without a length
+			unsigned int length = readBigEndian(file, 2);
+			if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+				file.get(); //Sample precision
+				size->height = readBigEndian(file, 2);
+				size->width = readBigEndian(file, 2);
+				return file && size->area() > 0;
+			}
+			file.seekg(length - 2, std::ios::cur);
+		}
+	} else if (sig[0] == 0x89 && sig[1] == 'P' && sig[2] == 'N' && sig[3] == 'G') { //PNG - IHDR is always the first chunk
+		file.seekg(16);
+		size->width = readBigEndian(file, 4);
+		size->height = readBigEndian(file, 4);
+		return file && size->area() > 0;
+	} else if (sig[0] == 0xFF && sig[1] == 0x4F && sig[2] == 0xFF && sig[3] == 0x51) { //JPEG 2000 codestream - SIZ marker follows the start marker
+		file.seekg(8);
+		unsigned int x = readBigEndian(file, 4), y = readBigEndian(file, 4);
+		unsigned int x0 = readBigEndian(file, 4), y0 = readBigEndian(file, 4);
+		size->width = x - x0;
+		size->height = y - y0;
+		return file && size->area() > 0;
+	} else if (memcmp(sig + 4, "jP  ", 4) == 0) { //JPEG 2000 file - image header box (ihdr) is near the start
+		char header[512] = { 0 };
+		file.seekg(0);
+		file.read(header, sizeof(header));
+		for (unsigned int i = 0; i + 12 <= sizeof(header); i++) {
+			if (memcmp(header + i, "ihdr", 4) == 0) {
+				file.clear();
+				file.seekg(i + 4);
+				size->height = readBigEndian(file, 4);
+				size->width = readBigEndian(file, 4);
+				return file && size->area() > 0;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Estimate the memory needed to decode an image from its header (3 bytes per pixel once decoded)
+ *
+ * @param path Path to the image
+ * @return Estimated memory (bytes), or an estimate from the file size if the header can't be read
+ */
+size_t imageMemory(fs::path path) {
+	Size size;
+	if (readImageSize(path, &size)) {
+		return (size_t)size.width * size.height * 3;
+	}
+	return fs::file_size(path) * 10; //Typical JPEG compression ratio
+}
+
+/*
+ * Estimate the memory needed by createThumbnail (every image is held at once, plus the combined image of the same size)
+ *
+ * @param image_dir Directory that the images are stored in
+ * @param max_pics Maximum number of pictures to show in the thumbnail
+ * @return Estimated memory (bytes)
+ */
+size_t thumbnailMemory(fs::path image_dir, int max_pics) {
+	int c = 0;
+	size_t bytes = 0;
+	for (auto &f : fs::directory_iterator(image_dir)) {
+		if (isImage(f.path().extension().string()) && (c < max_pics || max_pics < 1)) {
+			bytes += imageMemory(f.path());
+			c++;
+		}
+	}
+	return 2 * bytes;
+}
+
+/*
+ * Estimate the memory needed by createWebp (images are converted one at a time, and the encoder needs about as much again as the decoded image)
+ *
+ * @param image_dir Directory that the images are stored in
+ * @return Estimated memory (bytes)
+ */
+size_t webpMemory(fs::path image_dir) {
+	size_t bytes = 0;
+	for (auto &f : fs::directory_iterator(image_dir)) {
+		if (isImage(f.path().extension().string())) {
+			bytes = max(bytes, imageMemory(f.path()));
+		}
+	}
+	return 2 * bytes;
+}
+
+/*
+ * Get the size of the screen. The display is only queried the first time, as opening a connection to the X server is slow
+ *
+ * @return Screen size (pixels)
+ */
+Size getScreenSize() {
+	static Size screen_size;
+	if (screen_size.area() == 0) {
+#ifdef _WIN32
+		screen_size = Size(GetSystemMetrics(SM_CXSCREEN), GetSystemMetrics(SM_CYSCREEN));
+#elif __linux__
+		Display* d = XOpenDisplay(NULL);
+		if (d) {
+			Screen*  s = DefaultScreenOfDisplay(d);
+			screen_size = Size(s->width, s->height);
+			XCloseDisplay(d);
+		}
+#endif
+		if (screen_size.area() == 0) screen_size = Size(1920, 1080); //No display to query
+	}
+	return screen_size;
+}
+
+/*
+ * Get the size to display an image at so it fits on the screen (leaving room for the window borders and trackbars)
+ *
+ * @param image_size Size of the image
+ * @return Display size (pixels)
+ */
+Size fitToScreen(Size image_size) {
+	Size screen = getScreenSize();
+	double scale = min((screen.width - 200) / (double)image_size.width, (screen.height - 200) / (double)image_size.height);
+	return Size(max(1, (int)(image_size.width * scale)), max(1, (int)(image_size.height * scale)));
+}
+
+
+/*
+ * Sort image paths by file name (the order the duplicate photo index compares obverse/reverse pairs in)
+ *
+ * @param files Image paths to sort
+ */
+void sortByName(vector<fs::path> &files) {
+	std::sort(files.begin(), files.end(), [](const fs::path &a, const fs::path &b) { return a.filename().string() < b.filename().string(); });
+}
 
 /*
  * Create thumbnail images from the images in the given directory, up to a maximum of max_pics in the image (should be an even number of picures - obverse/reverse pairs). Saves to thumbnail.jpg in given directory
+ * Pairs where both pictures duplicate an earlier pair are left out if the directory has a duplicate photo index
  *
  * @param image_dir Directory that the images are stored in
  * @param thumbnail_width Width (pixels) of the thumbnail image
  * @param max_pics Maximum number of pictures to show in the thumbnail
+ * @param verbose Verbose (print duplicates left out)
  */
-int createThumbnail(fs::path image_dir, int thumbnail_height, int max_pics) {
+int createThumbnail(fs::path image_dir, int thumbnail_height, int max_pics, bool verbose) {
 	int c = 0;
 	vector<Mat> pictures;
-	int max_width[2]; int max_height = 0; //Maximum sizes of pictures
+	int max_width[2] = { 0, 0 }; int max_height = 0; //Maximum sizes of pictures
 
-	for (auto &f : fs::directory_iterator(image_dir)) { //Read each image file into vector
-		if (isImage(f.path().extension().string()) && (c < max_pics || max_pics < 1)) { //Only read JPG files and upto max_pics (but not if max_pics is less than 0)
-			pictures.push_back(imread(f.path().string()));
+	vector<fs::path> files;
+	for (auto &f : fs::directory_iterator(image_dir)) {
+		if (isImage(f.path().extension().string()) && f.path().filename() != THUMBNAIL_NAME) files.push_back(f.path());
+	}
+	sortByName(files); //Obverse/reverse pairs alternate in name order (directory order is not name order on every filesystem)
+	std::set<std::string> duplicates = findDuplicates(image_dir, files, verbose);
+
+	for (unsigned int i = 0; i < files.size(); i++) { //Read each image file into vector
+		unsigned int pair = i - i % 2;
+		if (pair + 1 < files.size() && duplicates.count(files[pair].filename().string()) && duplicates.count(files[pair + 1].filename().string())) { //Skip duplicate obverse/reverse pairs
+			if (verbose && i == pair) printLine("\t\tLeaving duplicate pair " + files[pair].filename().string() + ", " + files[pair + 1].filename().string() + " out of thumbnail");
+			continue;
+		}
+		if (c < max_pics || max_pics < 1) { //Only read upto max_pics (but not if max_pics is less than 0)
+			pictures.push_back(imread(files[i].string()));
 			max_height = max(max_height, pictures[c].rows);
 			max_width[c%2] = max(max_width[c % 2], pictures[c].cols);
 			c++;
@@ -54,7 +248,7 @@ int createThumbnail(fs::path image_dir, int thumbnail_height, int max_pics) {
 	}
 
 	if (c % 2 != 0) {
-		std::cout << "Error! " << image_dir << ": Must be an even number of files in each folder (obverse/reverse pairs) or max_pics of >=1 (current number: " << c << ")" << std::endl;
+		printLine("Error! \"" + image_dir.string() + "\": Must be an even number of files in each folder (obverse/reverse pairs) or max_pics of >=1 (current number: " + std::to_string(c) + ")");
 		return 1;
 	}
 
@@ -84,12 +278,12 @@ int createThumbnail(fs::path image_dir, int thumbnail_height, int max_pics) {
 	}
 	Mat3b res;
 	resize(thumbnail, res, Size(thumbnail_height * thumbnail.cols / thumbnail.rows, thumbnail_height));
-	imwrite(image_dir.append("thumbnail.jpg").string(), res);
+	imwrite(image_dir.append(THUMBNAIL_NAME).string(), res);
 	return 0;
 }
 
 /*
- * Create WebP images from the images in the given directory
+ * Create WebP images from the images in the given directory (skipping duplicates if the directory has a duplicate photo index)
  *
  * @param image_dir Directory that the images are stored in
  * @param quality WebP image quality (0-100)
@@ -99,13 +293,26 @@ int createWebp(fs::path image_dir, int quality, bool verbose) {
 	vector<int> params;
 	params.push_back(IMWRITE_WEBP_QUALITY);
 	params.push_back(quality);
-	for (auto &f : fs::directory_iterator(image_dir)) { //Each image file
-		if (isImage(f.path().extension().string())) {
-			if (verbose) std::cout << "\t\tCreating WebP image for " << f.path().filename() << std::endl;
-			Mat img = imread(f.path().string());
-			fs::path img_out = image_dir / (f.path().stem().string() + ".webp");
-			imwrite(img_out.string(), img, params);
+	vector<fs::path> files, pictures; //Images to convert, and the coin pictures among them (without the thumbnail, so obverse/reverse pairs line up)
+	for (auto &f : fs::directory_iterator(image_dir)) {
+		if (!isImage(f.path().extension().string())) continue;
+		files.push_back(f.path());
+		if (f.path().filename() != THUMBNAIL_NAME) pictures.push_back(f.path());
+	}
+	sortByName(files);
+	sortByName(pictures);
+	std::set<std::string> duplicates = findDuplicates(image_dir, pictures, verbose);
+
+	int status = 0;
+	for (auto &f : files) { //Each image file
+		if (duplicates.count(f.filename().string())) continue;
+		if (verbose) printLine("\t\tCreating WebP image for " + f.filename().string());
+		Mat img = imread(f.string());
+		fs::path img_out = image_dir / (f.stem().string() + ".webp");
+		if (!img.data || !imwrite(img_out.string(), img, params)) {
+			printLine("Error! " + f.string() + ": Unable to create WebP image");
+			status = 1;
 		}
 	}
-	return 0;
+	return status;
 }
\ No newline at end of file
@@ -5,7 +5,25 @@
 
 bool isImage(std::string ext); //Determine if the file is an image
 
-int createThumbnail(fs::path image_dir, int thumbnail_height, int max_pics); //Create a thumbnail image given the images in the directory at path with a maximum number of pictures max_pics
+void sortByName(vector<fs::path> &files); //Sort image paths by file name (obverse/reverse pairs alternate in this order)
+
+std::string fileStamp(fs::path path); //Get a stamp for the current version of a file (changes whenever the file is rewritten)
+
+bool readImageSize(fs::path path, Size *size); //Read the size of an image from its header without decoding it
+
+size_t imageMemory(fs::path path); //Estimate the memory needed to decode an image
+
+size_t thumbnailMemory(fs::path image_dir, int max_pics); //Estimate the memory needed by createThumbnail
+
+size_t webpMemory(fs::path image_dir); //Estimate the memory needed by createWebp
+
+Size getScreenSize(); //Get the size of the screen (queried once)
+
+Size fitToScreen(Size image_size); //Get the size to display an image at so it fits on the screen
+
+#define THUMBNAIL_NAME "thumbnail.jpg"
+
+int createThumbnail(fs::path image_dir, int thumbnail_height, int max_pics, bool verbose); //Create a thumbnail image given the images in the directory at path with a maximum number of pictures max_pics
 
 int createWebp(fs::path image_dir, int quality, bool verbose); //Create WebP versions of each JPEG image file in image_dir
 
@@ -0,0 +1,260 @@
+/*
+ * PerceptualHash.cpp - Index perceptual hashes of the images in each directory to find duplicate or near-identical photos
+ * This file is part of CoinPictureManager.
+ *
+ * Copyright (C) 2020  PolarPiBerry
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "PerceptualHash.h"
+#include "ImageFunctions.h"
+#include "Scheduler.h"
+
+#include <bitset>
+#include <map>
+#include <sstream>
+
+int duplicate_distance = DUPLICATE_DISTANCE;
+
+//Hash of one image in a directory index
+struct HashEntry {
+	std::string stamp; //Version of the image file when it was hashed
+	uint64_t hash;
+};
+
+/*
+ * Get the number of bits that differ between two hashes
+ *
+ * @param a First hash
+ * @param b Second hash
+ * @return Hamming distance (0-64)
+ */
+int hashDistance(uint64_t a, uint64_t b) {
+	return (int)std::bitset<64>(a ^ b).count();
+}
+
+/*
+ * Compute the difference hash (dHash) of an image: each bit is set if a pixel of the 9x8 grayscale image is darker than the pixel to its right.
+ * The image is decoded at 1/8 scale, which is much faster than a full decode for JPEG images
+ *
+ * @param path Path to the image
+ * @param hash Pointer to store the hash in
+ * @return bool if the image could be read
+ */
+bool imageHash(fs::path path, uint64_t *hash) {
+	Mat img = imread(path.string(), IMREAD_REDUCED_GRAYSCALE_8);
+	if (!img.data) return false;
+	Mat small;
+	resize(img, small, Size(9, 8), 0, 0, INTER_AREA);
+
+	*hash = 0;
+	for (int y = 0; y < 8; y++) {
+		for (int x = 0; x < 8; x++) {
+			*hash = (*hash << 1) | (small.at<uchar>(y, x) < small.at<uchar>(y, x + 1));
+		}
+	}
+	return true;
+}
+
+/*
+ * Read the hash index of a directory
+ *
+ * @param image_dir Directory that the images are stored in
+ * @param entries Pointer to a map to store the hashes in (by image file name)
+ * @return bool if the directory has an index
+ */
+bool readHashIndex(fs::path image_dir, std::map<std::string, HashEntry> *entries) {
+	fs::path index_path = image_dir / HASH_INDEX_NAME;
+	if (!fs::exists(index_path)) return false;
+	FileStorage store(index_path.string(), FileStorage::READ);
+	if (!store.isOpened()) return false;
+
+	FileNode nodes = store["images"];
+	for (FileNodeIterator it = nodes.begin(); it != nodes.end(); ++it) {
+		FileNode n = *it;
+		HashEntry e;
+		e.stamp = (std::string)n["stamp"];
+		std::string hash = (std::string)n["hash"];
+		char *end;
+		e.hash = strtoull(hash.c_str(), &end, 16);
+		if (hash.empty() || *end != '\0') continue; //Missing or corrupt hash - the image is hashed again on the next update
+		(*entries)[(std::string)n["name"]] = e;
+	}
+	return true;
+}
+
+/*
+ * Write the hash index of a directory
+ *
+ * @param image_dir Directory that the images are stored in
+ * @param entries Hashes to write (by image file name)
+ */
+void writeHashIndex(fs::path image_dir, std::map<std::string, HashEntry> &entries) {
+	FileStorage store((image_dir / HASH_INDEX_NAME).string(), FileStorage::WRITE);
+	store << "images" << "[";
+	for (auto &e : entries) {
+		std::stringstream hash;
+		hash << std::hex << std::setw(16) << std::setfill('0') << e.second.hash;
+		store << "{" << "name" << e.first << "stamp" << e.second.stamp << "hash" << hash.str() << "}";
+	}
+	store << "]";
+}
+
+/*
+ * Estimate the memory needed by updateHashIndex (images are decoded one at a time - JPEG images at 1/8 scale, others at full size and then shrunk)
+ *
+ * @param image_dir Directory that the images are stored in
+ * @return Estimated memory (bytes)
+ */
+size_t hashMemory(fs::path image_dir) {
+	size_t bytes = 0;
+	for (auto &f : fs::directory_iterator(image_dir)) {
+		std::string ext = f.path().extension().string();
+		if (isImage(ext)) {
+			std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+			bool reduced = ext == ".jpg" || ext == ".jpeg" || ext == ".jpe";
+			bytes = max(bytes, reduced ? imageMemory(f.path()) / 64 : imageMemory(f.path()));
+		}
+	}
+	return bytes;
+}
+
+/*
+ * Hash the images in the directory that are new or have changed since the index was last updated, and save the index (HASH_INDEX_NAME)
+ *
+ * @param image_dir Directory that the images are stored in
+ * @param verbose Verbose (print duplicates found)
+ * @return Success code (1 if an image could not be hashed)
+ */
+int updateHashIndex(fs::path image_dir, bool verbose) {
+	std::map<std::string, HashEntry> old_entries, entries;
+	readHashIndex(image_dir, &old_entries);
+
+	int status = 0;
+	int hashed = 0;
+	for (auto &f : fs::directory_iterator(image_dir)) { //Each image file
+		if (!isImage(f.path().extension().string()) || f.path().filename() == THUMBNAIL_NAME) continue;
+		std::string name = f.path().filename().string();
+		HashEntry e;
+		e.stamp = fileStamp(f.path());
+		auto old = old_entries.find(name);
+		if (old != old_entries.end() && old->second.stamp == e.stamp) { //Unchanged
+			entries[name] = old->second;
+		} else if (imageHash(f.path(), &e.hash)) {
+			entries[name] = e;
+			hashed++;
+		} else {
+			printLine("Error! " + f.path().string() + ": Unable to open image");
+			status = 1;
+		}
+	}
+	if (hashed > 0 || entries.size() != old_entries.size()) writeHashIndex(image_dir, entries);
+
+	if (verbose) { //Compare every pair of images on the same side (obverse/reverse alternate in file name order)
+		std::stringstream out;
+		out << "\t\t" << image_dir.filename().string() << ": " << hashed << " image(s) hashed, " << entries.size() << " in index";
+		int i = 0;
+		for (auto a = entries.begin(); a != entries.end(); ++a, i++) {
+			int j = 0;
+			for (auto b = entries.begin(); b != a; ++b, j++) {
+				int distance = hashDistance(a->second.hash, b->second.hash);
+				if (i % 2 == j % 2 && distance <= duplicate_distance) {
+					out << std::endl << "\t\tDuplicate: " << a->first << " of " << b->first << " (" << distance << " bits differ)";
+					break;
+				}
+			}
+		}
+		printLine(out.str());
+	}
+	return status;
+}
+
+/*
+ * Get the names of the images that duplicate an earlier image in the list. Only images on the same side are compared (even and odd positions
+ * hold obverse and reverse pictures), as the two sides of a round coin can hash alike. Only directories with an index are checked (the index is updated first)
+ *
+ * @param image_dir Directory that the images are stored in
+ * @param images Images in the order they are processed
+ * @param verbose Verbose (print duplicates found)
+ * @return File names of the duplicate images
+ */
+std::set<std::string> findDuplicates(fs::path image_dir, vector<fs::path> &images, bool verbose) {
+	std::set<std::string> duplicates;
+	if (!fs::exists(image_dir / HASH_INDEX_NAME)) return duplicates;
+	updateHashIndex(image_dir, false);
+	std::map<std::string, HashEntry> entries;
+	readHashIndex(image_dir, &entries);
+
+	for (unsigned int i = 0; i < images.size(); i++) {
+		auto a = entries.find(images[i].filename().string());
+		if (a == entries.end()) continue;
+		for (unsigned int j = i % 2; j < i; j += 2) {
+			auto b = entries.find(images[j].filename().string());
+			int distance = (b != entries.end()) ? hashDistance(a->second.hash, b->second.hash) : 65;
+			if (distance <= duplicate_distance) {
+				if (verbose) printLine("\t\tDuplicate: " + a->first + " of " + b->first + " (" + std::to_string(distance) + " bits differ)");
+				duplicates.insert(a->first);
+				break;
+			}
+		}
+	}
+	return duplicates;
+}
+
+/*
+ * Find images in the indexes of the subdirectories of root_dir that duplicate the image at image_path (indexes are read, not updated)
+ *
+ * @param root_dir Top directory (to search below)
+ * @param image_path Path to the image to look for
+ * @param verbose Verbose (print load and search times)
+ * @return Success code (1 if the image could not be read)
+ */
+int findImage(fs::path root_dir, fs::path image_path, bool verbose) {
+	uint64_t query;
+	if (!imageHash(image_path, &query)) {
+		std::cout << "Error! " << image_path.string() << ": Unable to open image" << std::endl;
+		return 1;
+	}
+
+	//Load every index into one flat list, so the search is a single pass over the hashes
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+	vector<uint64_t> hashes;
+	vector<std::string> names;
+	for (auto &d : fs::directory_iterator(root_dir)) { //Each sub-directory
+		std::map<std::string, HashEntry> entries;
+		if (!fs::is_directory(d) || !readHashIndex(d.path(), &entries)) continue;
+		for (auto &e : entries) {
+			hashes.push_back(e.second.hash);
+			names.push_back((d.path().filename() / e.first).string());
+		}
+	}
+	std::chrono::steady_clock::time_point loaded_time = std::chrono::steady_clock::now();
+
+	vector<size_t> matches;
+	for (size_t i = 0; i < hashes.size(); i++) {
+		if (hashDistance(query, hashes[i]) <= duplicate_distance) matches.push_back(i);
+	}
+	std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
+
+	for (size_t i : matches) {
+		std::cout << names[i] << " (" << hashDistance(query, hashes[i]) << " bits differ)" << std::endl;
+	}
+	std::cout << matches.size() << " duplicate(s) of " << image_path.filename() << " in " << hashes.size() << " indexed images" << std::endl;
+	if (verbose) {
+		std::cout << "\tIndexes loaded in " << std::chrono::duration_cast<std::chrono::milliseconds>(loaded_time - start_time).count() << " ms, searched in "
+			<< std::chrono::duration_cast<std::chrono::microseconds>(end_time - loaded_time).count() << " us" << std::endl;
+	}
+	return 0;
+}
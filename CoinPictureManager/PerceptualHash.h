@@ -0,0 +1,23 @@
+#ifndef PERCEPTUALHASH_H
+#define PERCEPTUALHASH_H
+
+#include "Dependencies.h"
+
+#include <set>
+
+#define HASH_INDEX_NAME "phash.json"
+#define DUPLICATE_DISTANCE 4 //Default maximum number of differing hash bits for two images to be duplicates
+
+extern int duplicate_distance; //Maximum number of differing hash bits for two images to be duplicates (set with --dup-distance)
+
+bool imageHash(fs::path path, uint64_t *hash); //Compute the difference hash (dHash) of an image from a reduced-resolution decode
+
+size_t hashMemory(fs::path image_dir); //Estimate the memory needed by updateHashIndex
+
+int updateHashIndex(fs::path image_dir, bool verbose); //Hash new or changed images in image_dir and save the index (HASH_INDEX_NAME), printing duplicates in verbose mode
+
+std::set<std::string> findDuplicates(fs::path image_dir, vector<fs::path> &images, bool verbose); //Get the names of images that duplicate an earlier image on the same side (obverse/reverse) in the list (only if image_dir has an index)
+
+int findImage(fs::path root_dir, fs::path image_path, bool verbose); //Find images in the indexes of the subdirectories of root_dir that duplicate the image at image_path
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Scheduler.cpp - Run image jobs in parallel while keeping their estimated memory use within a budget
+ * This file is part of CoinPictureManager.
+ *
+ * Copyright (C) 2020  PolarPiBerry
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "Scheduler.h"
+#include "ImageFunctions.h"
+
+size_t memory_limit = 0;
+
+std::mutex print_lock; //Keep lines printed by different jobs from mixing
+
+/*
+ * Print a line to the console in one piece (jobs running on other threads can't print in the middle of it)
+ *
+ * @param line Line to print (without the newline)
+ */
+void printLine(std::string line) {
+	std::lock_guard<std::mutex> l(print_lock);
+	std::cout << line << std::endl;
+}
+
+/*
+ * Create a governor with the given budget
+ *
+ * @param limit Memory budget (bytes, 0 for no limit)
+ */
+MemoryGovernor::MemoryGovernor(size_t limit) : limit(limit) {}
+
+/*
+ * Wait until the bytes fit within the budget and take them. Jobs are admitted in the order they ask, so a large job is not starved by smaller ones
+ *
+ * @param bytes Estimated memory needed
+ */
+void MemoryGovernor::acquire(size_t bytes) {
+	std::unique_lock<std::mutex> l(lock);
+	unsigned long ticket = next_ticket++;
+	queued += bytes;
+	peak_queued = max(peak_queued, queued);
+	changed.wait(l, [&] {
+		return ticket == serving && (limit == 0 || in_use == 0 || in_use + bytes <= limit);
+	});
+	queued -= bytes;
+	in_use += bytes;
+	peak_in_use = max(peak_in_use, in_use);
+	serving++;
+	changed.notify_all();
+}
+
+/*
+ * Return bytes taken by acquire to the budget
+ *
+ * @param bytes Estimated memory that was needed
+ */
+void MemoryGovernor::release(size_t bytes) {
+	std::lock_guard<std::mutex> l(lock);
+	in_use -= bytes;
+	changed.notify_all();
+}
+
+/*
+ * Print the peak memory in use and waiting to be admitted
+ */
+void MemoryGovernor::print() {
+	std::lock_guard<std::mutex> l(lock);
+	std::cout << "\tMemory: peak " << (peak_in_use >> 20) << " MB in use, peak " << (peak_queued >> 20) << " MB queued";
+	if (limit > 0) std::cout << " (limit " << (limit >> 20) << " MB)";
+	std::cout << std::endl;
+}
+
+/*
+ * Run the jobs on one thread per core, admitting each job once its estimated memory fits within memory_limit
+ *
+ * @param jobs Jobs to run
+ * @param verbose Verbose
+ * @return Number of jobs that failed
+ */
+int runJobs(vector<Job> &jobs, bool verbose) {
+	MemoryGovernor governor(memory_limit);
+	std::mutex next_lock;
+	size_t next = 0;
+	int failed = 0;
+
+	auto worker = [&]() {
+		while (1) {
+			size_t i;
+			{
+				std::lock_guard<std::mutex> l(next_lock);
+				if (next == jobs.size()) return;
+				i = next++;
+			}
+			Job &job = jobs.at(i);
+			governor.acquire(job.bytes);
+			if (verbose) printLine("\tDirectory: \"" + job.name + "\" (" + std::to_string(job.bytes >> 20) + " MB)");
+			int status = job.run();
+			governor.release(job.bytes);
+			if (status != 0) {
+				std::lock_guard<std::mutex> l(next_lock);
+				failed++;
+			}
+		}
+	};
+
+	unsigned int n_threads = max(1u, min(std::thread::hardware_concurrency(), (unsigned int)jobs.size()));
+	vector<std::thread> threads;
+	for (unsigned int t = 0; t < n_threads; t++) {
+		threads.push_back(std::thread(worker));
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	if (verbose) governor.print();
+	return failed;
+}
+
+/*
+ * Create an empty queue
+ *
+ * @param capacity Maximum number of items in the queue
+ */
+ReviewQueue::ReviewQueue(size_t capacity) : capacity(capacity) {}
+
+/*
+ * Add an item to the end of the queue, waiting while the queue is full
+ *
+ * @param item Item to add
+ */
+void ReviewQueue::push(ReviewItemPtr item) {
+	std::unique_lock<std::mutex> l(lock);
+	changed.wait(l, [&] { return items.size() < capacity; });
+	items.push_back(item);
+	changed.notify_all();
+}
+
+/*
+ * Take the item at the front of the queue, waiting until there is one
+ *
+ * @return Item, or an empty pointer once the queue is closed and empty
+ */
+ReviewItemPtr ReviewQueue::pop() {
+	std::unique_lock<std::mutex> l(lock);
+	changed.wait(l, [&] { return items.size() > 0 || closed; });
+	if (items.size() == 0) return ReviewItemPtr();
+	ReviewItemPtr item = items.front();
+	items.pop_front();
+	changed.notify_all();
+	return item;
+}
+
+/*
+ * Mark that no more items will be added (pop returns an empty pointer once the queue is empty)
+ */
+void ReviewQueue::close() {
+	std::lock_guard<std::mutex> l(lock);
+	closed = true;
+	changed.notify_all();
+}
+
+/*
+ * Get the number of items waiting in the queue
+ *
+ * @return Number of items
+ */
+size_t ReviewQueue::size() {
+	std::lock_guard<std::mutex> l(lock);
+	return items.size();
+}
+
+/*
+ * Review each file in turn on this thread (the GUI must stay on the main thread). A background thread reads and prepares the next
+ * few files while the operator reviews the current one, and a pool of threads saves the reviewed files in parallel, so the operator only waits
+ * to decide. Each image takes its estimated memory from memory_limit before it is read and returns it once it is saved (or fails)
+ *
+ * @param files Image files to review, in order
+ * @param create Function to create an empty item of the command's type
+ * @param prepare Function to read and analyze an image (run in the background)
+ * @param review Function to show an image to the operator (run on this thread)
+ * @param save Function to save a reviewed image (run in the background, several at once)
+ * @param verbose Verbose
+ * @return Number of images that failed
+ */
+int runReview(vector<fs::path> &files, std::function<ReviewItemPtr()> create, std::function<int(ReviewItem*)> prepare, std::function<int(ReviewItem*)> review, std::function<int(ReviewItem*)> save, bool verbose) {
+	const size_t prepare_ahead = 3; //Number of images prepared ahead of the operator
+	unsigned int n_savers = max(2u, std::thread::hardware_concurrency()) - 1; //Leave a core for preparing images
+	ReviewQueue prepared(prepare_ahead);
+	ReviewQueue reviewed(n_savers);
+	MemoryGovernor governor(memory_limit);
+	std::mutex failed_lock;
+	int failed = 0;
+
+	std::thread preparer([&]() {
+		for (auto &f : files) {
+			ReviewItemPtr item = create();
+			item->path = f;
+			item->bytes = 4 * imageMemory(f); //Decoded image, BGRA copy and encoder buffers
+			governor.acquire(item->bytes);
+			item->status = prepare(item.get());
+			prepared.push(item);
+		}
+		prepared.close();
+	});
+
+	auto saver = [&]() {
+		for (ReviewItemPtr item = reviewed.pop(); item; item = reviewed.pop()) {
+			size_t bytes = item->bytes;
+			int status = save(item.get());
+			item.reset();
+			governor.release(bytes);
+			if (status != 0) {
+				std::lock_guard<std::mutex> l(failed_lock);
+				failed++;
+			}
+		}
+	};
+	vector<std::thread> savers;
+	for (unsigned int t = 0; t < n_savers; t++) {
+		savers.push_back(std::thread(saver));
+	}
+
+	for (ReviewItemPtr item = prepared.pop(); item; item = prepared.pop()) {
+		if (verbose) printLine("\t\tImage: " + item->path.string() + " (" + std::to_string(prepared.size()) + " more ready)");
+		if (item->status != 0 || review(item.get()) != 0) {
+			size_t bytes = item->bytes;
+			item.reset();
+			governor.release(bytes);
+			std::lock_guard<std::mutex> l(failed_lock);
+			failed++;
+			continue;
+		}
+		reviewed.push(item);
+	}
+	reviewed.close();
+
+	preparer.join();
+	for (auto &t : savers) {
+		t.join();
+	}
+	if (verbose) governor.print();
+	return failed;
+}
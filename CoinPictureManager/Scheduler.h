@@ -0,0 +1,70 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Dependencies.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+extern size_t memory_limit; //Memory budget (bytes) for jobs run at the same time (0 for no limit)
+
+//Unit of work run by runJobs
+struct Job {
+	std::string name; //Name shown in verbose mode
+	size_t bytes; //Estimated memory needed to run the job
+	std::function<int()> run; //Function to run (returns success code)
+};
+
+//Admits jobs in order while their estimated memory fits within a budget
+class MemoryGovernor {
+	public:
+		MemoryGovernor(size_t limit);
+		void acquire(size_t bytes); //Wait until the bytes fit in the budget (a job larger than the budget runs alone)
+		void release(size_t bytes); //Return the bytes to the budget
+		void print(); //Print peak memory in use and queued
+	private:
+		std::mutex lock;
+		std::condition_variable changed;
+		size_t limit, in_use = 0, queued = 0, peak_in_use = 0, peak_queued = 0;
+		unsigned long next_ticket = 0, serving = 0;
+};
+
+void printLine(std::string line); //Print a line without it mixing with lines printed by other jobs
+
+int runJobs(vector<Job> &jobs, bool verbose); //Run the jobs in parallel, keeping their estimated memory within memory_limit
+
+//Image in the interactive review commands, prepared in the background before the operator reaches it (each command extends it with its own state)
+struct ReviewItem {
+	fs::path path; //Image file (input and output)
+	Mat image; //Full-size image
+	Mat preview; //Display-size copy shown to the operator
+	int status = 0; //Success code of preparing the image
+	size_t bytes = 0; //Estimated memory taken from memory_limit until the image is saved
+	virtual ~ReviewItem() {}
+};
+
+typedef std::shared_ptr<ReviewItem> ReviewItemPtr;
+
+//Queue of review items passed between threads
+class ReviewQueue {
+	public:
+		ReviewQueue(size_t capacity);
+		void push(ReviewItemPtr item); //Add an item, waiting while the queue is full
+		ReviewItemPtr pop(); //Take the next item, waiting until there is one (empty pointer once the queue is closed and empty)
+		void close(); //Mark that no more items will be added
+		size_t size();
+	private:
+		std::mutex lock;
+		std::condition_variable changed;
+		std::deque<ReviewItemPtr> items;
+		size_t capacity;
+		bool closed = false;
+};
+
+int runReview(vector<fs::path> &files, std::function<ReviewItemPtr()> create, std::function<int(ReviewItem*)> prepare, std::function<int(ReviewItem*)> review, std::function<int(ReviewItem*)> save, bool verbose); //Run the review function on each file on this thread while the next files are prepared and reviewed files are saved in parallel in the background
+
+#endif